@@ -0,0 +1,219 @@
+/*  Copyright (C) 2012-2017 by László Nagy
+    This file is part of Bear.
+
+    Bear is a tool to generate compilation database for clang tooling.
+
+    Bear is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Bear is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The file layout (all numbers are little endian) is written by the
+ * 'CompilationIndex' class of the 'bear' command:
+ *
+ *   header     magic "BEARIDX\0", version, entry count, bucket count,
+ *              and the offset of each section below.
+ *   strings    interned, zero terminated UTF-8 strings.
+ *   arguments  array of u32 string offsets. Entries with the same
+ *              argument list share the same slice.
+ *   entries    array of { file, directory, arguments, argument count,
+ *              next, hash } u32 records. 'next' chains the entries which
+ *              are in the same bucket.
+ *   buckets    array of u32, the first entry of the chain (or zero).
+ *
+ * Entry and bucket references are biased by one, so zero means none.
+ */
+
+#include "bearindex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define MAGIC "BEARIDX"
+#define VERSION 1
+#define HEADER_SIZE 64
+#define ENTRY_SIZE 24
+
+enum {
+    ENTRY_FILE = 0,
+    ENTRY_DIRECTORY,
+    ENTRY_ARGUMENTS,
+    ENTRY_ARGUMENT_COUNT,
+    ENTRY_NEXT,
+    ENTRY_HASH
+};
+
+static uint32_t read_u32(unsigned char const *ptr) {
+    return (uint32_t)ptr[0]
+        | ((uint32_t)ptr[1] << 8)
+        | ((uint32_t)ptr[2] << 16)
+        | ((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t read_u64(unsigned char const *ptr) {
+    return (uint64_t)read_u32(ptr) | ((uint64_t)read_u32(ptr + 4) << 32);
+}
+
+static uint32_t hash_string(char const *str) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char const *it = (unsigned char const *)str; *it; ++it) {
+        hash ^= *it;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int section_is_valid(size_t size, uint64_t offset, uint64_t length) {
+    return (offset <= size) && (length <= size - offset);
+}
+
+static uint32_t entry_field(bear_index_t const *index, bear_index_entry_t entry, int field) {
+    return read_u32(index->entries + (entry - 1) * ENTRY_SIZE + field * 4);
+}
+
+static char const *string_at(bear_index_t const *index, uint32_t offset) {
+    // the pool is zero terminated, so any offset inside is a valid string
+    return (offset < index->strings_size)
+        ? (char const *)index->strings + offset
+        : 0;
+}
+
+int bear_index_open(bear_index_t *index, char const *path) {
+    memset(index, 0, sizeof(bear_index_t));
+
+    int fd = open(path, O_RDONLY);
+    if (-1 == fd)
+        return -1;
+    struct stat st;
+    if (-1 == fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    size_t const size = (size_t)st.st_size;
+    if (size < HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void *base = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base)
+        return -1;
+
+    unsigned char const *const header = (unsigned char const *)base;
+    uint64_t const strings = read_u64(header + 24);
+    uint64_t const strings_size = read_u64(header + 32);
+    uint64_t const arguments = read_u64(header + 40);
+    uint64_t const entries = read_u64(header + 48);
+    uint64_t const buckets = read_u64(header + 56);
+    uint32_t const entry_count = read_u32(header + 12);
+    uint32_t const bucket_count = read_u32(header + 16);
+
+    if ((0 != memcmp(header, MAGIC, sizeof(MAGIC))) ||
+        (VERSION != read_u32(header + 8)) ||
+        (0 == bucket_count) ||
+        (0 == strings_size) ||
+        (!section_is_valid(size, strings, strings_size)) ||
+        (0 != header[strings + strings_size - 1]) ||
+        (entries < arguments) || ((entries - arguments) % 4) ||
+        (!section_is_valid(size, arguments, entries - arguments)) ||
+        (!section_is_valid(size, entries, (uint64_t)entry_count * ENTRY_SIZE)) ||
+        (!section_is_valid(size, buckets, (uint64_t)bucket_count * 4))) {
+        munmap(base, size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    index->base = header;
+    index->size = size;
+    index->entry_count = entry_count;
+    index->bucket_count = bucket_count;
+    index->strings = header + strings;
+    index->strings_size = (size_t)strings_size;
+    index->arguments = header + arguments;
+    index->argument_count = (size_t)(entries - arguments) / 4;
+    index->entries = header + entries;
+    index->buckets = header + buckets;
+    return 0;
+}
+
+void bear_index_close(bear_index_t *index) {
+    if (index->base)
+        munmap((void *)index->base, index->size);
+    memset(index, 0, sizeof(bear_index_t));
+}
+
+static bear_index_entry_t find_from(bear_index_t const *index, bear_index_entry_t entry,
+                                    char const *file, uint32_t hash) {
+    for (; (entry) && (entry <= index->entry_count);
+         entry = entry_field(index, entry, ENTRY_NEXT)) {
+        if (hash != entry_field(index, entry, ENTRY_HASH))
+            continue;
+        char const *const candidate = bear_index_file(index, entry);
+        if ((candidate) && (0 == strcmp(candidate, file)))
+            return entry;
+    }
+    return 0;
+}
+
+bear_index_entry_t bear_index_find(bear_index_t const *index, char const *file) {
+    if (0 == index->base)
+        return 0;
+    uint32_t const hash = hash_string(file);
+    uint32_t const bucket = hash % index->bucket_count;
+    bear_index_entry_t const first = read_u32(index->buckets + bucket * 4);
+    return find_from(index, first, file, hash);
+}
+
+bear_index_entry_t bear_index_find_next(bear_index_t const *index, bear_index_entry_t entry) {
+    if ((0 == entry) || (entry > index->entry_count))
+        return 0;
+    char const *const file = bear_index_file(index, entry);
+    if (0 == file)
+        return 0;
+    bear_index_entry_t const next = entry_field(index, entry, ENTRY_NEXT);
+    return find_from(index, next, file, entry_field(index, entry, ENTRY_HASH));
+}
+
+char const *bear_index_file(bear_index_t const *index, bear_index_entry_t entry) {
+    if ((0 == entry) || (entry > index->entry_count))
+        return 0;
+    return string_at(index, entry_field(index, entry, ENTRY_FILE));
+}
+
+char const *bear_index_directory(bear_index_t const *index, bear_index_entry_t entry) {
+    if ((0 == entry) || (entry > index->entry_count))
+        return 0;
+    return string_at(index, entry_field(index, entry, ENTRY_DIRECTORY));
+}
+
+size_t bear_index_argc(bear_index_t const *index, bear_index_entry_t entry) {
+    if ((0 == entry) || (entry > index->entry_count))
+        return 0;
+    uint32_t const begin = entry_field(index, entry, ENTRY_ARGUMENTS);
+    uint32_t const count = entry_field(index, entry, ENTRY_ARGUMENT_COUNT);
+    return ((size_t)begin + count <= index->argument_count) ? count : 0;
+}
+
+char const *bear_index_argv(bear_index_t const *index, bear_index_entry_t entry, size_t n) {
+    if (n >= bear_index_argc(index, entry))
+        return 0;
+    uint32_t const begin = entry_field(index, entry, ENTRY_ARGUMENTS);
+    return string_at(index, read_u32(index->arguments + (begin + n) * 4));
+}
@@ -0,0 +1,71 @@
+/*  Copyright (C) 2012-2017 by László Nagy
+    This file is part of Bear.
+
+    Bear is a tool to generate compilation database for clang tooling.
+
+    Bear is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Bear is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Reader of the binary compilation index written by 'bear --index'.
+ *
+ * The index is mapped into memory and every query is answered from the
+ * mapped pages directly. Returned strings point into the mapping, those
+ * are valid until the index is closed.
+ *
+ * Entries are keyed by the absolute path of the source file. The same file
+ * might be compiled multiple times, therefore a lookup returns the first
+ * match and the rest can be iterated with 'bear_index_find_next'.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    unsigned char const *base;
+    size_t size;
+    uint32_t entry_count;
+    uint32_t bucket_count;
+    unsigned char const *strings;
+    size_t strings_size;
+    unsigned char const *arguments;
+    size_t argument_count;
+    unsigned char const *entries;
+    unsigned char const *buckets;
+} bear_index_t;
+
+/* Entry handle. Zero value means no entry. */
+typedef uint32_t bear_index_entry_t;
+
+/* Returns 0 on success, -1 on failure (errno is set). */
+int bear_index_open(bear_index_t *index, char const *path);
+void bear_index_close(bear_index_t *index);
+
+bear_index_entry_t bear_index_find(bear_index_t const *index, char const *file);
+bear_index_entry_t bear_index_find_next(bear_index_t const *index, bear_index_entry_t entry);
+
+char const *bear_index_file(bear_index_t const *index, bear_index_entry_t entry);
+char const *bear_index_directory(bear_index_t const *index, bear_index_entry_t entry);
+size_t bear_index_argc(bear_index_t const *index, bear_index_entry_t entry);
+char const *bear_index_argv(bear_index_t const *index, bear_index_entry_t entry, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
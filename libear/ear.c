@@ -32,6 +32,7 @@
  */
 
 #include "config.h"
+#include "report.h"
 
 #include <stddef.h>
 #include <stdarg.h>
@@ -44,6 +45,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <time.h>
 #include <pthread.h>
 #include <errno.h>
 
@@ -62,23 +64,29 @@ static char **environ;
 extern char **environ;
 #endif
 
-#define ENV_OUTPUT "INTERCEPT_BUILD_TARGET_DIR"
 #ifdef APPLE
 # define ENV_FLAT    "DYLD_FORCE_FLAT_NAMESPACE"
 # define ENV_PRELOAD "DYLD_INSERT_LIBRARIES"
-# define ENV_SIZE 3
+# define ENV_REQUIRED 3
 #else
 # define ENV_PRELOAD "LD_PRELOAD"
-# define ENV_SIZE 2
+# define ENV_REQUIRED 2
 #endif
+#define ENV_STATS "INTERCEPT_BUILD_STATS"
+// The optional variables follow the required ones.
+#define ENV_INCLUDE_AT ENV_REQUIRED
+#define ENV_EXCLUDE_AT (ENV_REQUIRED + 1)
+#define ENV_STATS_AT (ENV_REQUIRED + 2)
+#define ENV_DRY_RUN_AT (ENV_REQUIRED + 3)
+#define ENV_DEDUP_AT (ENV_REQUIRED + 4)
+#define ENV_COMPRESS_AT (ENV_REQUIRED + 5)
+#define ENV_SIZE (ENV_REQUIRED + 6)
 
-#define STRINGIFY(x) #x
-#define TOSTRING(x) STRINGIFY(x)
-#define AT "libear: (" __FILE__ ":" TOSTRING(__LINE__) ") "
+#define STATS_FILE_PREFIX "stats"
 
-#define PERROR(msg) do { perror(AT msg); } while (0)
-
-#define ERROR_AND_EXIT(msg) do { PERROR(msg); exit(EXIT_FAILURE); } while (0)
+// The spawn reports are written, when the batch reaches these limits.
+#define BATCH_SIZE_LIMIT (64 * 1024)
+#define BATCH_TIME_LIMIT_NS 1000000000ull
 
 #define DLSYM(TYPE_, VAR_, SYMBOL_)                                 \
     union {                                                         \
@@ -94,14 +102,56 @@ extern char **environ;
 
 typedef char const * bear_env_t[ENV_SIZE];
 
+typedef enum {
+    CALL_EXECVE,
+    CALL_EXECV,
+    CALL_EXECVPE,
+    CALL_EXECVP,
+    CALL_EXECVP2,
+    CALL_EXECT,
+    CALL_EXECL,
+    CALL_EXECLP,
+    CALL_EXECLE,
+    CALL_POSIX_SPAWN,
+    CALL_POSIX_SPAWNP,
+    CALL_SIZE
+} bear_call_t;
+
+typedef struct {
+    FILE *stream;
+    char *data;
+    size_t size;
+    unsigned long long start;
+} bear_batch_t;
+
+typedef struct {
+    unsigned long calls[CALL_SIZE];
+    unsigned long records;
+    unsigned long duplicates;
+    unsigned long overflows;
+    unsigned long bytes;
+    unsigned long report_ns;
+    unsigned long environ_ns;
+} bear_stats_t;
+
 static int capture_env_t(bear_env_t *env);
 static void release_env_t(bear_env_t *env);
 static char const **string_array_partial_update(char *const envp[], bear_env_t *env);
 static char const **string_array_single_update(char const **in, char const *key, char const *value);
-static void report_call(char const *const argv[]);
-static void write_report(int fd, char const *const argv[]);
-static int write_json_report(int fd, char const *const cmd[], char const *cwd, pid_t pid);
-static int encode_json_string(char const *src, char *dst, size_t dst_size);
+static void report_call(bear_call_t call, char const *const argv[]);
+static void report_spawn(bear_call_t call, char const *const argv[], pid_t pid, unsigned long long seq);
+static void report_process(bear_call_t call, char const *const argv[],
+                           pid_t pid, pid_t ppid, unsigned long long seq, int batched);
+static void batch_append(char const *const argv[], pid_t pid, pid_t ppid, unsigned long long seq);
+static void batch_flush(void);
+static void batch_lock(void);
+static void batch_unlock(void);
+static void batch_forget(void);
+static void on_fork_child(void);
+static int dry_run_call(char const *const argv[]);
+static void dry_run_exit(char const *const argv[]);
+static unsigned long stats_clock(void);
+static void stats_flush(void);
 static char const **string_array_from_varargs(char const *arg, va_list *ap);
 static char const **string_array_copy(char const **const in);
 static size_t string_array_length(char const *const *in);
@@ -114,6 +164,12 @@ static bear_env_t env_names =
 #ifdef ENV_FLAT
     , ENV_FLAT
 #endif
+    , ENV_INCLUDE
+    , ENV_EXCLUDE
+    , ENV_STATS
+    , ENV_DRY_RUN
+    , ENV_DEDUP
+    , ENV_COMPRESS
     };
 
 static bear_env_t initial_env =
@@ -122,8 +178,45 @@ static bear_env_t initial_env =
 #ifdef ENV_FLAT
     , 0
 #endif
+    , 0
+    , 0
+    , 0
+    , 0
+    , 0
+    , 0
+    };
+
+static char const *const call_names[CALL_SIZE] =
+    { "execve"
+    , "execv"
+    , "execvpe"
+    , "execvp"
+    , "execvP"
+    , "exect"
+    , "execl"
+    , "execlp"
+    , "execle"
+    , "posix_spawn"
+    , "posix_spawnp"
     };
 
+static bear_stats_t stats;
+
+static bear_seen_t seen;
+static pthread_once_t seen_once = PTHREAD_ONCE_INIT;
+
+static void seen_open(void);
+
+#ifdef HAVE_OPEN_MEMSTREAM
+static bear_batch_t batch;
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bear_dictionary_t dictionary;
+static int dictionary_loaded = 0;
+
+static void batch_flush_locked(void);
+static bear_dictionary_t const *batch_dictionary(void);
+#endif
+
 static int initialized = 0;
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static locale_t utf_locale;
@@ -180,10 +273,18 @@ static void on_load(void) {
     pthread_mutex_unlock(&mutex);
 }
 
+static void on_fork_child(void) {
+    batch_forget();
+    memset(&stats, 0, sizeof(stats));
+}
+
 static void on_unload(void) {
     pthread_mutex_lock(&mutex);
-    if (initialized)
+    if (initialized) {
+        batch_flush();
+        stats_flush();
         mt_safe_on_unload();
+    }
     initialized = 0;
     pthread_mutex_unlock(&mutex);
 }
@@ -203,6 +304,11 @@ static int mt_safe_on_load(void) {
     // Capture current relevant environment variables
     if (0 == capture_env_t(&initial_env))
         return 0;
+    // The child process shall not write the reports of the parent
+    if (0 != pthread_atfork(batch_lock, batch_unlock, on_fork_child)) {
+        PERROR("pthread_atfork");
+        return 0;
+    }
     // Well done
     return 1;
 }
@@ -218,7 +324,8 @@ static void mt_safe_on_unload(void) {
 
 #ifdef HAVE_EXECVE
 int execve(const char *path, char *const argv[], char *const envp[]) {
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECVE, (char const *const *)argv);
+    dry_run_exit((char const *const *)argv);
     return call_execve(path, argv, envp);
 }
 #endif
@@ -228,35 +335,40 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 #error can not implement execv without execve
 #endif
 int execv(const char *path, char *const argv[]) {
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECV, (char const *const *)argv);
+    dry_run_exit((char const *const *)argv);
     return call_execve(path, argv, environ);
 }
 #endif
 
 #ifdef HAVE_EXECVPE
 int execvpe(const char *file, char *const argv[], char *const envp[]) {
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECVPE, (char const *const *)argv);
+    dry_run_exit((char const *const *)argv);
     return call_execvpe(file, argv, envp);
 }
 #endif
 
 #ifdef HAVE_EXECVP
 int execvp(const char *file, char *const argv[]) {
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECVP, (char const *const *)argv);
+    dry_run_exit((char const *const *)argv);
     return call_execvp(file, argv);
 }
 #endif
 
 #ifdef HAVE_EXECVP2
 int execvP(const char *file, const char *search_path, char *const argv[]) {
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECVP2, (char const *const *)argv);
+    dry_run_exit((char const *const *)argv);
     return call_execvP(file, search_path, argv);
 }
 #endif
 
 #ifdef HAVE_EXECT
 int exect(const char *path, char *const argv[], char *const envp[]) {
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECT, (char const *const *)argv);
+    dry_run_exit((char const *const *)argv);
     return call_exect(path, argv, envp);
 }
 #endif
@@ -271,7 +383,9 @@ int execl(const char *path, const char *arg, ...) {
     char const **argv = string_array_from_varargs(arg, &args);
     va_end(args);
 
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECL, (char const *const *)argv);
+
+    dry_run_exit((char const *const *)argv);
     int const result = call_execve(path, (char *const *)argv, environ);
 
     string_array_release(argv);
@@ -289,7 +403,9 @@ int execlp(const char *file, const char *arg, ...) {
     char const **argv = string_array_from_varargs(arg, &args);
     va_end(args);
 
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECLP, (char const *const *)argv);
+
+    dry_run_exit((char const *const *)argv);
     int const result = call_execvp(file, (char *const *)argv);
 
     string_array_release(argv);
@@ -309,7 +425,9 @@ int execle(const char *path, const char *arg, ...) {
     char const **envp = va_arg(args, char const **);
     va_end(args);
 
-    report_call((char const *const *)argv);
+    report_call(CALL_EXECLE, (char const *const *)argv);
+
+    dry_run_exit((char const *const *)argv);
     int const result =
         call_execve(path, (char *const *)argv, (char *const *)envp);
 
@@ -323,18 +441,39 @@ int posix_spawn(pid_t *restrict pid, const char *restrict path,
                 const posix_spawn_file_actions_t *file_actions,
                 const posix_spawnattr_t *restrict attrp,
                 char *const argv[restrict], char *const envp[restrict]) {
-    report_call((char const *const *)argv);
-    return call_posix_spawn(pid, path, file_actions, attrp, argv, envp);
+    unsigned long long const seq = report_sequence();
+    pid_t child = 0;
+    char const *const dry_run_argv[] = { "sh", "-c", "exit 0", 0 };
+    int const result = (dry_run_call((char const *const *)argv))
+        ? call_posix_spawn(&child, "/bin/sh", file_actions, attrp, (char *const *)dry_run_argv, envp)
+        : call_posix_spawn(&child, path, file_actions, attrp, argv, envp);
+    if (pid)
+        *pid = child;
+    if (0 == result)
+        report_spawn(CALL_POSIX_SPAWN, (char const *const *)argv, child, seq);
+    return result;
 }
 #endif
 
 #ifdef HAVE_POSIX_SPAWNP
+#ifndef HAVE_POSIX_SPAWN
+#error can not implement posix_spawnp without posix_spawn
+#endif
 int posix_spawnp(pid_t *restrict pid, const char *restrict file,
                  const posix_spawn_file_actions_t *file_actions,
                  const posix_spawnattr_t *restrict attrp,
                  char *const argv[restrict], char *const envp[restrict]) {
-    report_call((char const *const *)argv);
-    return call_posix_spawnp(pid, file, file_actions, attrp, argv, envp);
+    unsigned long long const seq = report_sequence();
+    pid_t child = 0;
+    char const *const dry_run_argv[] = { "sh", "-c", "exit 0", 0 };
+    int const result = (dry_run_call((char const *const *)argv))
+        ? call_posix_spawn(&child, "/bin/sh", file_actions, attrp, (char *const *)dry_run_argv, envp)
+        : call_posix_spawnp(&child, file, file_actions, attrp, argv, envp);
+    if (pid)
+        *pid = child;
+    if (0 == result)
+        report_spawn(CALL_POSIX_SPAWNP, (char const *const *)argv, child, seq);
+    return result;
 }
 #endif
 
@@ -349,6 +488,8 @@ static int call_execve(const char *path, char *const argv[],
     DLSYM(func, fp, "execve");
 
     char const **const menvp = string_array_partial_update(envp, &initial_env);
+    batch_flush();
+    stats_flush();
     int const result = (*fp)(path, argv, (char *const *)menvp);
     string_array_release(menvp);
     return result;
@@ -363,6 +504,8 @@ static int call_execvpe(const char *file, char *const argv[],
     DLSYM(func, fp, "execvpe");
 
     char const **const menvp = string_array_partial_update(envp, &initial_env);
+    batch_flush();
+    stats_flush();
     int const result = (*fp)(file, argv, (char *const *)menvp);
     string_array_release(menvp);
     return result;
@@ -378,6 +521,8 @@ static int call_execvp(const char *file, char *const argv[]) {
     char **const original = environ;
     char const **const modified = string_array_partial_update(original, &initial_env);
     environ = (char **)modified;
+    batch_flush();
+    stats_flush();
     int const result = (*fp)(file, argv);
     environ = original;
     string_array_release(modified);
@@ -396,6 +541,8 @@ static int call_execvP(const char *file, const char *search_path,
     char **const original = environ;
     char const **const modified = string_array_partial_update(original, &initial_env);
     environ = (char **)modified;
+    batch_flush();
+    stats_flush();
     int const result = (*fp)(file, search_path, argv);
     environ = original;
     string_array_release(modified);
@@ -412,6 +559,8 @@ static int call_exect(const char *path, char *const argv[],
     DLSYM(func, fp, "exect");
 
     char const **const menvp = string_array_partial_update(envp, &initial_env);
+    batch_flush();
+    stats_flush();
     int const result = (*fp)(path, argv, (char *const *)menvp);
     string_array_release(menvp);
     return result;
@@ -460,123 +609,215 @@ static int call_posix_spawnp(pid_t *restrict pid, const char *restrict file,
 }
 #endif
 
-/* this method is to write log about the process creation. */
+/* this method is to write log about the process creation. when it was
+ * requested, the report is compressed into the spool of the process group. */
+
+static void report_call(bear_call_t call, char const *const argv[]) {
+    report_process(call, argv, getpid(), getppid(), report_sequence(), 0);
+}
+
+/* the spawned process is reported after it was created, because the child
+ * pid is not known before. the sequence is taken before the call, to order
+ * it before the executions of the child. the calling process survives the
+ * call, so the report is batched with the others of this process. */
+
+static void report_spawn(bear_call_t call, char const *const argv[], pid_t pid, unsigned long long seq) {
+    report_process(call, argv, pid, getpid(), seq, 1);
+}
 
-static void report_call(char const *const argv[]) {
+static void report_process(bear_call_t call, char const *const argv[],
+                           pid_t pid, pid_t ppid, unsigned long long seq, int batched) {
     if (!initialized)
         return;
-    // Create report file name
-    char const * const out_dir = initial_env[0];
-    size_t const path_max_length = strlen(out_dir) + 32;
-    char filename[path_max_length];
-    if (-1 == snprintf(filename, path_max_length, "%s/execution.XXXXXX", out_dir))
-        ERROR_AND_EXIT("snprintf");
-    // Create report file
-    int fd = mkstemp((char *)&filename);
-    if (-1 == fd)
-        ERROR_AND_EXIT("mkstemp");
-    // Write report file
-    write_report(fd, argv);
-    // Close report file
-    if (close(fd))
-        ERROR_AND_EXIT("close");
+
+    unsigned long const start = stats_clock();
+    __sync_fetch_and_add(&stats.calls[call], 1);
+    if (report_accept(initial_env[ENV_INCLUDE_AT], initial_env[ENV_EXCLUDE_AT], argv)) {
+        pthread_once(&seen_once, seen_open);
+        int const duplicate = report_seen(&seen, argv);
+        if (1 == duplicate) {
+            __sync_fetch_and_add(&stats.duplicates, 1);
+        } else {
+            if (-1 == duplicate)
+                __sync_fetch_and_add(&stats.overflows, 1);
+            if (batched)
+                batch_append(argv, pid, ppid, seq);
+            else if (initial_env[ENV_COMPRESS_AT])
+                __sync_fetch_and_add(&stats.bytes, report_spool(initial_env[0], argv, pid, ppid, seq, utf_locale));
+            else
+                __sync_fetch_and_add(&stats.bytes, report_write(initial_env[0], argv, pid, ppid, seq, utf_locale));
+            __sync_fetch_and_add(&stats.records, 1);
+        }
+    }
+    __sync_fetch_and_add(&stats.report_ns, stats_clock() - start);
+}
+
+/* the hash set of the reported executions is mapped at the first report of
+ * the process, and it stays mapped (also in the forked children) until the
+ * process image is replaced or the process exits. */
+
+static void seen_open(void) {
+    // Failing to use the hash set is not fatal, the execution is reported.
+    if (-1 == report_seen_open(initial_env[ENV_DEDUP_AT], &seen))
+        PERROR("report_seen_open");
+}
+
+/* the batched reports are kept in memory, and written into a single report
+ * file when the size or the time limit was reached. the batch is written
+ * before the process image is replaced and when the library is unloaded.
+ * (a forked child drops its copy of the batch and of the statistics, the
+ * parent writes those.) the written bytes of the batch are counted, when
+ * the batch is written. when it was requested, the batch is compressed. */
+
+#ifdef HAVE_OPEN_MEMSTREAM
+static void batch_append(char const *const argv[], pid_t pid, pid_t ppid, unsigned long long seq) {
+    pthread_mutex_lock(&batch_mutex);
+    if (0 == batch.stream) {
+        batch.stream = open_memstream(&batch.data, &batch.size);
+        if (0 == batch.stream)
+            ERROR_AND_EXIT("open_memstream");
+        batch.start = seq;
+    }
+    report_print(batch.stream, argv, pid, ppid, seq, utf_locale);
+    if (fflush(batch.stream))
+        ERROR_AND_EXIT("fflush");
+    if ((batch.size >= BATCH_SIZE_LIMIT) ||
+        (report_sequence() - batch.start >= BATCH_TIME_LIMIT_NS))
+        batch_flush_locked();
+    pthread_mutex_unlock(&batch_mutex);
 }
 
-static void write_report(int fd, char const *const argv[]) {
-    const locale_t saved_locale = uselocale(utf_locale);
-    if ((locale_t)0 == saved_locale)
-        ERROR_AND_EXIT("uselocale");
+static void batch_flush(void) {
+    pthread_mutex_lock(&batch_mutex);
+    batch_flush_locked();
+    pthread_mutex_unlock(&batch_mutex);
+}
 
-    const char *cwd = getcwd(NULL, 0);
-    if (0 == cwd)
-        ERROR_AND_EXIT("getcwd");
-    if (write_json_report(fd, argv, cwd, getpid()))
-        ERROR_AND_EXIT("writing json problem");
-    free((void *)cwd);
+static void batch_flush_locked(void) {
+    if (0 == batch.stream)
+        return;
 
-    const locale_t restored_locale = uselocale(saved_locale);
-    if ((locale_t)0 == restored_locale)
-        ERROR_AND_EXIT("uselocale");
+    if (fclose(batch.stream))
+        ERROR_AND_EXIT("fclose");
+    size_t const bytes = report_store(initial_env[0], batch_dictionary(), batch.data, batch.size);
+    __sync_fetch_and_add(&stats.bytes, bytes);
+    free((void *)batch.data);
+    memset(&batch, 0, sizeof(batch));
 }
 
-static int write_json_report(int fd, char const *const cmd[], char const *const cwd, pid_t pid) {
-    if (0 > dprintf(fd, "{ \"pid\": %d, \"cmd\": [", pid))
-        return -1;
+/* the preset dictionary is read only once per process, when the first
+ * batch is written. (a forked child inherits it.) without the dictionary
+ * file the batch is still compressed. */
 
-    for (char const *const *it = cmd; (it) && (*it); ++it) {
-        char const *const sep = (it != cmd) ? "," : "";
-        const size_t buffer_size = (6 * strlen(*it)) + 1;
-        char buffer[buffer_size];
-        if (-1 == encode_json_string(*it, buffer, buffer_size))
-            return -1;
-        if (0 > dprintf(fd, "%s \"%s\"", sep, buffer))
-            return -1;
-    }
-    const size_t buffer_size = 6 * strlen(cwd);
-    char buffer[buffer_size];
-    if (-1 == encode_json_string(cwd, buffer, buffer_size))
-        return -1;
-    if (0 > dprintf(fd, "], \"cwd\": \"%s\" }", buffer))
-        return -1;
-
-    return 0;
-}
-
-static int encode_json_string(char const *const src, char *const dst, size_t const dst_size) {
-    size_t const wsrc_length = mbstowcs(NULL, src, 0);
-    wchar_t wsrc[wsrc_length + 1];
-    if (mbstowcs((wchar_t *)&wsrc, src, wsrc_length + 1) != wsrc_length) {
-        PERROR("mbstowcs");
-        return -1;
+static bear_dictionary_t const *batch_dictionary(void) {
+    if (0 == initial_env[ENV_COMPRESS_AT])
+        return 0;
+    if (!dictionary_loaded) {
+        if (-1 == report_dictionary(initial_env[ENV_COMPRESS_AT], &dictionary))
+            PERROR("report_dictionary");
+        dictionary_loaded = 1;
     }
-    wchar_t const *wsrc_it = (wchar_t const *)&wsrc;
-    wchar_t const *const wsrc_end = wsrc_it + wsrc_length;
+    return &dictionary;
+}
 
-    char *dst_it = dst;
-    char *const dst_end = dst + dst_size;
+static void batch_lock(void) {
+    pthread_mutex_lock(&batch_mutex);
+}
 
-    for (; wsrc_it != wsrc_end; ++wsrc_it) {
-        if (dst_it >= dst_end) {
-            return -1;
-        }
-        // Insert an escape character before control characters.
-        switch (*wsrc_it) {
-        case L'\b':
-            dst_it += snprintf(dst_it, 3, "\\b");
-            break;
-        case L'\f':
-            dst_it += snprintf(dst_it, 3, "\\f");
-            break;
-        case L'\n':
-            dst_it += snprintf(dst_it, 3, "\\n");
-            break;
-        case L'\r':
-            dst_it += snprintf(dst_it, 3, "\\r");
-            break;
-        case L'\t':
-            dst_it += snprintf(dst_it, 3, "\\t");
-            break;
-        case L'"':
-            dst_it += snprintf(dst_it, 3, "\\\"");
-            break;
-        case L'\\':
-            dst_it += snprintf(dst_it, 3, "\\\\");
-            break;
-        default:
-            if ((*wsrc_it < L' ') || (*wsrc_it > 127)) {
-                dst_it += snprintf(dst_it, 7, "\\u%04x", (unsigned int)*wsrc_it);
-            } else {
-                *dst_it++ = (char)*wsrc_it;
-            }
-            break;
-        }
-    }
-    if (dst_it < dst_end) {
-        // Insert a terminating 0 value.
-        *dst_it = 0;
+static void batch_unlock(void) {
+    pthread_mutex_unlock(&batch_mutex);
+}
+
+static void batch_forget(void) {
+    memset(&batch, 0, sizeof(batch));
+    pthread_mutex_unlock(&batch_mutex);
+}
+#else
+static void batch_append(char const *const argv[], pid_t pid, pid_t ppid, unsigned long long seq) {
+    __sync_fetch_and_add(&stats.bytes, report_write(initial_env[0], argv, pid, ppid, seq, utf_locale));
+}
+
+static void batch_flush(void) {
+}
+
+static void batch_lock(void) {
+}
+
+static void batch_unlock(void) {
+}
+
+static void batch_forget(void) {
+}
+#endif
+
+/* in dry run mode the compiler calls are not executed, but the outputs are
+ * created as the compiler would do. the exec calls terminate the process
+ * (as the compiler would do with success), while the spawn calls execute
+ * a shell which does nothing. */
+
+static int dry_run_call(char const *const argv[]) {
+    if (!initialized)
+        return 0;
+
+    return report_dry_run(initial_env[ENV_DRY_RUN_AT], argv);
+}
+
+static void dry_run_exit(char const *const argv[]) {
+    if (!dry_run_call(argv))
+        return;
+
+    batch_flush();
+    stats_flush();
+    _exit(EXIT_SUCCESS);
+}
+
+/* the statistics are collected only when it was requested. the counters
+ * are written into a separate file of the output directory, before the
+ * process image is replaced or when the library is unloaded. */
+
+static unsigned long stats_clock(void) {
+    if (0 == initial_env[ENV_STATS_AT])
+        return 0;
+
+    struct timespec now;
+    if (-1 == clock_gettime(CLOCK_MONOTONIC, &now))
         return 0;
+    return (unsigned long)now.tv_sec * 1000000000ul + (unsigned long)now.tv_nsec;
+}
+
+static void stats_flush(void) {
+    if ((!initialized) || (0 == initial_env[ENV_STATS_AT]))
+        return;
+
+    // Take the counters and reset them, in case the exec call fails.
+    bear_stats_t current;
+    unsigned long total = 0;
+    for (size_t it = 0; it < CALL_SIZE; ++it) {
+        current.calls[it] = __sync_fetch_and_and(&stats.calls[it], 0);
+        total += current.calls[it];
+    }
+    current.records = __sync_fetch_and_and(&stats.records, 0);
+    current.duplicates = __sync_fetch_and_and(&stats.duplicates, 0);
+    current.overflows = __sync_fetch_and_and(&stats.overflows, 0);
+    current.bytes = __sync_fetch_and_and(&stats.bytes, 0);
+    current.report_ns = __sync_fetch_and_and(&stats.report_ns, 0);
+    current.environ_ns = __sync_fetch_and_and(&stats.environ_ns, 0);
+    if (0 == total)
+        return;
+
+    int const fd = report_create(initial_env[0], STATS_FILE_PREFIX);
+    if (0 > dprintf(fd, "{ \"pid\": %d, \"calls\": {", getpid()))
+        ERROR_AND_EXIT("dprintf");
+    for (size_t it = 0; it < CALL_SIZE; ++it) {
+        char const *const sep = (it) ? "," : "";
+        if (0 > dprintf(fd, "%s \"%s\": %lu", sep, call_names[it], current.calls[it]))
+            ERROR_AND_EXIT("dprintf");
     }
-    return -1;
+    if (0 > dprintf(fd, " }, \"records\": %lu, \"duplicates\": %lu, \"dedup_overflows\": %lu, \"bytes\": %lu, \"report_ns\": %lu, \"environ_ns\": %lu }",
+                    current.records, current.duplicates, current.overflows, current.bytes, current.report_ns, current.environ_ns))
+        ERROR_AND_EXIT("dprintf");
+    if (close(fd))
+        ERROR_AND_EXIT("close");
 }
 
 /* update environment assure that chilren processes will copy the desired
@@ -586,6 +827,10 @@ static int capture_env_t(bear_env_t *env) {
     int status = 1;
     for (size_t it = 0; it < ENV_SIZE; ++it) {
         char const * const env_value = getenv(env_names[it]);
+        if ((0 == env_value) && (it >= ENV_REQUIRED)) {
+            (*env)[it] = 0;
+            continue;
+        }
         char const * const env_copy = (env_value) ? strdup(env_value) : env_value;
         (*env)[it] = env_copy;
         status &= (env_copy) ? 1 : 0;
@@ -604,9 +849,13 @@ static void release_env_t(bear_env_t *env) {
 }
 
 static char const **string_array_partial_update(char *const envp[], bear_env_t *env) {
+    unsigned long const start = stats_clock();
     char const **result = string_array_copy((char const **)envp);
-    for (size_t it = 0; it < ENV_SIZE && (*env)[it]; ++it)
-        result = string_array_single_update(result, env_names[it], (*env)[it]);
+    for (size_t it = 0; it < ENV_SIZE; ++it) {
+        if ((*env)[it])
+            result = string_array_single_update(result, env_names[it], (*env)[it]);
+    }
+    __sync_fetch_and_add(&stats.environ_ns, stats_clock() - start);
     return result;
 }
 
@@ -0,0 +1,676 @@
+/*  Copyright (C) 2012-2017 by László Nagy
+    This file is part of Bear.
+
+    Bear is a tool to generate compilation database for clang tooling.
+
+    Bear is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Bear is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "report.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// The number of slots to try, before the hash set is considered to be full.
+#define SEEN_PROBE_LIMIT 64
+// The deflate window size, longer dictionary is not used.
+#define DICTIONARY_SIZE_LIMIT 32768
+// The size of the spool head, which reports are written as they are.
+#define SPOOL_SEED_LIMIT 4096
+
+/* Returns the number of bytes written, or -1 on failure. */
+static int write_json_report(FILE *stream, char const *const cmd[], char const *cwd,
+                             pid_t pid, pid_t ppid, unsigned long long seq);
+static int encode_json_string(char const *src, char *dst, size_t dst_size);
+static int is_source_file(char const *arg);
+static void normalize_path(char *path);
+static int path_accepted(char const *include, char const *exclude, char const *path);
+static int patterns_match(char const *patterns, char const *path);
+static int pattern_match(char const *pattern, size_t pattern_length, char const *path);
+static int is_compiler(char const *patterns, char const *program);
+static int create_unique(char const *out_dir, char const *prefix, char *filename, size_t length);
+static int create_file(char const *path, char const *content);
+static int simulate_output(char const *output, char const *depfile, int depend);
+static int create_depfile(char const *depfile, char const *output);
+static uint64_t execution_hash(char const *cwd, char const *const argv[]);
+static uint64_t fnv_hash(uint64_t hash, char const *value);
+static size_t write_content(int fd, void const *data, size_t size);
+#if defined HAVE_ZLIB
+static size_t write_compressed(int fd, bear_dictionary_t const *dictionary, char const *data, size_t size);
+#endif
+#if defined HAVE_ZLIB && defined HAVE_OPEN_MEMSTREAM
+static size_t spool_seed(unsigned char const *data, size_t size);
+#endif
+
+
+int report_create(char const *const out_dir, char const *const prefix) {
+    size_t const path_max_length = strlen(out_dir) + strlen(prefix) + 32;
+    char filename[path_max_length];
+    return create_unique(out_dir, prefix, filename, path_max_length);
+}
+
+unsigned long long report_sequence(void) {
+    struct timespec now;
+    if (-1 == clock_gettime(CLOCK_MONOTONIC, &now))
+        ERROR_AND_EXIT("clock_gettime");
+    return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+}
+
+size_t report_write(char const *const out_dir, char const *const argv[],
+                    pid_t pid, pid_t ppid, unsigned long long seq, locale_t locale) {
+    // Create report file
+    int fd = report_create(out_dir, REPORT_FILE_PREFIX);
+    FILE *const stream = fdopen(fd, "w");
+    if (0 == stream)
+        ERROR_AND_EXIT("fdopen");
+    // Write report file
+    size_t const bytes = report_print(stream, argv, pid, ppid, seq, locale);
+    // Close report file
+    if (fclose(stream))
+        ERROR_AND_EXIT("fclose");
+    return bytes;
+}
+
+int report_dictionary(char const *const filename, bear_dictionary_t *const dictionary) {
+    memset(dictionary, 0, sizeof(bear_dictionary_t));
+    int const fd = open(filename, O_RDONLY);
+    if (-1 == fd)
+        return -1;
+    unsigned char *const data = malloc(DICTIONARY_SIZE_LIMIT);
+    if (0 == data)
+        ERROR_AND_EXIT("malloc");
+    ssize_t const size = read(fd, data, DICTIONARY_SIZE_LIMIT);
+    if (close(fd))
+        ERROR_AND_EXIT("close");
+    if (-1 == size) {
+        free((void *)data);
+        return -1;
+    }
+    dictionary->data = data;
+    dictionary->size = (size_t)size;
+    return 0;
+}
+
+size_t report_store(char const *const out_dir, bear_dictionary_t const *const dictionary,
+                    char const *const data, size_t const size) {
+    // The content is written into a file which is not a report (the readers
+    // ignore it), and renamed over an empty report file when it's complete.
+    // So readers never see a partially written report file.
+    size_t const path_max_length = strlen(out_dir) + 32;
+    char temporary[path_max_length];
+    int const fd = create_unique(out_dir, PARTIAL_FILE_PREFIX, temporary, path_max_length);
+#if defined HAVE_ZLIB
+    size_t const bytes = (dictionary)
+        ? write_compressed(fd, dictionary, data, size)
+        : write_content(fd, data, size);
+#else
+    (void)dictionary;
+    size_t const bytes = write_content(fd, data, size);
+#endif
+    if (close(fd))
+        ERROR_AND_EXIT("close");
+    char filename[path_max_length];
+    if (close(create_unique(out_dir, REPORT_FILE_PREFIX, filename, path_max_length)))
+        ERROR_AND_EXIT("close");
+    if (-1 == rename(temporary, filename))
+        ERROR_AND_EXIT("rename");
+    return bytes;
+}
+
+size_t report_spool(char const *const out_dir, char const *const argv[],
+                    pid_t pid, pid_t ppid, unsigned long long seq, locale_t locale) {
+#if defined HAVE_ZLIB && defined HAVE_OPEN_MEMSTREAM
+    char *data = 0;
+    size_t size = 0;
+    FILE *const stream = open_memstream(&data, &size);
+    if (0 == stream)
+        ERROR_AND_EXIT("open_memstream");
+    report_print(stream, argv, pid, ppid, seq, locale);
+    if (fclose(stream))
+        ERROR_AND_EXIT("fclose");
+
+    size_t const path_max_length = strlen(out_dir) + strlen(SPOOL_FILE_PREFIX) + 32;
+    char filename[path_max_length];
+    if (-1 == snprintf(filename, path_max_length, "%s/" SPOOL_FILE_PREFIX "%ld", out_dir, (long)getpgrp()))
+        ERROR_AND_EXIT("snprintf");
+    int const fd = open(filename, O_RDWR | O_APPEND | O_CREAT, 0600);
+    if (-1 == fd)
+        ERROR_AND_EXIT("open");
+    // The complete reports at the head of the spool are the dictionary. (The
+    // reader finds it by the checksum, which is in the compressed stream.)
+    unsigned char head[SPOOL_SEED_LIMIT];
+    ssize_t const length = pread(fd, head, sizeof(head), 0);
+    if (-1 == length)
+        ERROR_AND_EXIT("pread");
+    bear_dictionary_t const seed = { head, spool_seed(head, (size_t)length) };
+    size_t const bytes = ((seed.size == (size_t)length) && (seed.size + size <= SPOOL_SEED_LIMIT))
+        ? write_content(fd, data, size)
+        : write_compressed(fd, &seed, data, size);
+    if (close(fd))
+        ERROR_AND_EXIT("close");
+    free((void *)data);
+    return bytes;
+#else
+    return report_write(out_dir, argv, pid, ppid, seq, locale);
+#endif
+}
+
+int report_accept(char const *const include, char const *const exclude, char const *const argv[]) {
+    if ((0 == include || 0 == include[0]) && (0 == exclude || 0 == exclude[0]))
+        return 1;
+
+    const char *cwd = getcwd(NULL, 0);
+    if (0 == cwd)
+        ERROR_AND_EXIT("getcwd");
+    int has_source = 0;
+    int result = 0;
+    for (char const *const *it = argv; (it) && (*it) && (!result); ++it) {
+        if ((it == argv) || (!is_source_file(*it)))
+            continue;
+        has_source = 1;
+        size_t const path_length = strlen(cwd) + strlen(*it) + 2;
+        char path[path_length];
+        if (-1 == snprintf(path, path_length, "%s/%s", ('/' == (*it)[0]) ? "" : cwd, *it))
+            ERROR_AND_EXIT("snprintf");
+        normalize_path(path);
+        result = path_accepted(include, exclude, path);
+    }
+    if (!has_source)
+        result = path_accepted(include, exclude, cwd);
+    free((void *)cwd);
+    return result;
+}
+
+int report_seen_open(char const *const table, bear_seen_t *const seen) {
+    seen->slots = 0;
+    seen->count = 0;
+    if ((0 == table) || (0 == table[0]))
+        return 0;
+
+    int const fd = open(table, O_RDWR);
+    if (-1 == fd)
+        return -1;
+    struct stat status;
+    if (-1 == fstat(fd, &status)) {
+        close(fd);
+        return -1;
+    }
+    size_t const count = (size_t)status.st_size / sizeof(uint64_t);
+    uint64_t *const slots = (count)
+        ? mmap(0, count * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (MAP_FAILED == slots)
+        return -1;
+    seen->slots = slots;
+    seen->count = count;
+    return 0;
+}
+
+void report_seen_close(bear_seen_t *const seen) {
+    if ((seen->slots) && (-1 == munmap(seen->slots, seen->count * sizeof(uint64_t))))
+        PERROR("munmap");
+    seen->slots = 0;
+    seen->count = 0;
+}
+
+int report_seen(bear_seen_t const *const seen, char const *const argv[]) {
+    if (0 == seen->count)
+        return 0;
+
+    const char *cwd = getcwd(NULL, 0);
+    if (0 == cwd)
+        ERROR_AND_EXIT("getcwd");
+    uint64_t const key = execution_hash(cwd, argv);
+    free((void *)cwd);
+    // Open addressing with linear probing, the empty slots are zero. The
+    // slots are only written once, by the process which inserts the key.
+    for (size_t it = 0; (it < seen->count) && (it < SEEN_PROBE_LIMIT); ++it) {
+        uint64_t const found =
+            __sync_val_compare_and_swap(&seen->slots[(key + it) % seen->count], 0, key);
+        if (0 == found)
+            return 0;
+        if (key == found)
+            return 1;
+    }
+    return -1;
+}
+
+int report_dry_run(char const *const patterns, char const *const argv[]) {
+    if ((0 == patterns) || (0 == patterns[0]) || (0 == argv) || (0 == argv[0]))
+        return 0;
+    if (!is_compiler(patterns, argv[0]))
+        return 0;
+
+    int compiles = 0;
+    int assembly = 0;
+    int depend = 0;
+    char const *output = 0;
+    char const *depfile = 0;
+    for (char const *const *it = argv + 1; *it; ++it) {
+        // These calls write to the standard output.
+        if ((0 == strcmp(*it, "-E")) || (0 == strcmp(*it, "-M")) || (0 == strcmp(*it, "-MM")))
+            return 0;
+        else if (0 == strcmp(*it, "-c"))
+            compiles = 1;
+        else if (0 == strcmp(*it, "-S"))
+            compiles = assembly = 1;
+        else if ((0 == strcmp(*it, "-MD")) || (0 == strcmp(*it, "-MMD")))
+            depend = 1;
+        else if ((0 == strcmp(*it, "-o")) && (it[1]))
+            output = *++it;
+        else if (0 == strncmp(*it, "-o", 2))
+            output = *it + 2;
+        else if ((0 == strcmp(*it, "-MF")) && (it[1]))
+            depfile = *++it;
+        else if (0 == strncmp(*it, "-MF", 3))
+            depfile = *it + 3;
+    }
+    // Version queries and the like are executed. Link calls (output
+    // without compilation) are simulated, since the objects are empty.
+    if ((!compiles) && (0 == output))
+        return 0;
+
+    if (output)
+        return simulate_output(output, depfile, depend);
+
+    // Without output name the objects (and the dependency files) are
+    // written into the current directory, named after the source file.
+    for (char const *const *it = argv + 1; *it; ++it) {
+        if (!is_source_file(*it))
+            continue;
+        char const *const slash = strrchr(*it, '/');
+        char const *const name = (slash) ? slash + 1 : *it;
+        size_t const length = strlen(name) + 3;
+        char object[length];
+        if (-1 == snprintf(object, length, "%.*s.%s",
+                           (int)(strrchr(name, '.') - name), name, (assembly) ? "s" : "o"))
+            ERROR_AND_EXIT("snprintf");
+        if (!simulate_output(object, depfile, depend))
+            return 0;
+    }
+    return 1;
+}
+
+size_t report_print(FILE *const stream, char const *const argv[],
+                    pid_t pid, pid_t ppid, unsigned long long seq, locale_t locale) {
+    const locale_t saved_locale = uselocale(locale);
+    if ((locale_t)0 == saved_locale)
+        ERROR_AND_EXIT("uselocale");
+
+    const char *cwd = getcwd(NULL, 0);
+    if (0 == cwd)
+        ERROR_AND_EXIT("getcwd");
+    int const bytes = write_json_report(stream, argv, cwd, pid, ppid, seq);
+    if (-1 == bytes)
+        ERROR_AND_EXIT("writing json problem");
+    free((void *)cwd);
+
+    const locale_t restored_locale = uselocale(saved_locale);
+    if ((locale_t)0 == restored_locale)
+        ERROR_AND_EXIT("uselocale");
+    return (size_t)bytes;
+}
+
+static int write_json_report(FILE *const stream, char const *const cmd[], char const *const cwd,
+                             pid_t pid, pid_t ppid, unsigned long long seq) {
+    int bytes = fprintf(stream, "{ \"pid\": %d, \"ppid\": %d, \"seq\": %llu, \"cmd\": [", pid, ppid, seq);
+    if (0 > bytes)
+        return -1;
+
+    for (char const *const *it = cmd; (it) && (*it); ++it) {
+        char const *const sep = (it != cmd) ? "," : "";
+        const size_t buffer_size = (6 * strlen(*it)) + 1;
+        char buffer[buffer_size];
+        if (-1 == encode_json_string(*it, buffer, buffer_size))
+            return -1;
+        int const written = fprintf(stream, "%s \"%s\"", sep, buffer);
+        if (0 > written)
+            return -1;
+        bytes += written;
+    }
+    const size_t buffer_size = 6 * strlen(cwd);
+    char buffer[buffer_size];
+    if (-1 == encode_json_string(cwd, buffer, buffer_size))
+        return -1;
+    int const written = fprintf(stream, "], \"cwd\": \"%s\" }\n", buffer);
+    if (0 > written)
+        return -1;
+
+    return bytes + written;
+}
+
+static int encode_json_string(char const *const src, char *const dst, size_t const dst_size) {
+    size_t const wsrc_length = mbstowcs(NULL, src, 0);
+    wchar_t wsrc[wsrc_length + 1];
+    if (mbstowcs((wchar_t *)&wsrc, src, wsrc_length + 1) != wsrc_length) {
+        PERROR("mbstowcs");
+        return -1;
+    }
+    wchar_t const *wsrc_it = (wchar_t const *)&wsrc;
+    wchar_t const *const wsrc_end = wsrc_it + wsrc_length;
+
+    char *dst_it = dst;
+    char *const dst_end = dst + dst_size;
+
+    for (; wsrc_it != wsrc_end; ++wsrc_it) {
+        if (dst_it >= dst_end) {
+            return -1;
+        }
+        // Insert an escape character before control characters.
+        switch (*wsrc_it) {
+        case L'\b':
+            dst_it += snprintf(dst_it, 3, "\\b");
+            break;
+        case L'\f':
+            dst_it += snprintf(dst_it, 3, "\\f");
+            break;
+        case L'\n':
+            dst_it += snprintf(dst_it, 3, "\\n");
+            break;
+        case L'\r':
+            dst_it += snprintf(dst_it, 3, "\\r");
+            break;
+        case L'\t':
+            dst_it += snprintf(dst_it, 3, "\\t");
+            break;
+        case L'"':
+            dst_it += snprintf(dst_it, 3, "\\\"");
+            break;
+        case L'\\':
+            dst_it += snprintf(dst_it, 3, "\\\\");
+            break;
+        default:
+            if ((*wsrc_it < L' ') || (*wsrc_it > 127)) {
+                dst_it += snprintf(dst_it, 7, "\\u%04x", (unsigned int)*wsrc_it);
+            } else {
+                *dst_it++ = (char)*wsrc_it;
+            }
+            break;
+        }
+    }
+    if (dst_it < dst_end) {
+        // Insert a terminating 0 value.
+        *dst_it = 0;
+        return 0;
+    }
+    return -1;
+}
+
+static int is_source_file(char const *const arg) {
+    static char const *const extensions[] =
+        { "c", "i", "ii", "m", "mi", "mm", "mii", "C", "cc", "CC", "cp"
+        , "cpp", "cxx", "c++", "C++", "txx", "s", "S", "sx", "asm", 0
+        };
+
+    if ('-' == arg[0])
+        return 0;
+    char const *const dot = strrchr(arg, '.');
+    if ((0 == dot) || (0 != strchr(dot, '/')))
+        return 0;
+    for (char const *const *it = extensions; *it; ++it) {
+        if (0 == strcmp(dot + 1, *it))
+            return 1;
+    }
+    return 0;
+}
+
+static void normalize_path(char *const path) {
+    // Collapse the empty, `.` and `..` components of the absolute path in
+    // place, the same way as the driver does it (`os.path.normpath`).
+    char *out = path;
+    char const *it = path;
+    while (*it) {
+        while ('/' == *it)
+            ++it;
+        char const *const end = it + strcspn(it, "/");
+        size_t const length = (size_t)(end - it);
+        if ((2 == length) && (0 == strncmp(it, "..", 2))) {
+            while ((out > path) && ('/' != *--out))
+                ;
+        } else if ((0 != length) && !((1 == length) && ('.' == it[0]))) {
+            *out++ = '/';
+            memmove(out, it, length);
+            out += length;
+        }
+        it = end;
+    }
+    if (out == path)
+        *out++ = '/';
+    *out = 0;
+}
+
+static int path_accepted(char const *const include, char const *const exclude, char const *const path) {
+    if (exclude && patterns_match(exclude, path))
+        return 0;
+    return (0 == include || 0 == include[0] || patterns_match(include, path));
+}
+
+static int patterns_match(char const *const patterns, char const *const path) {
+    for (char const *it = patterns; *it; ) {
+        char const *end = strchr(it, ':');
+        if (0 == end)
+            end = it + strlen(it);
+        if ((end != it) && pattern_match(it, (size_t)(end - it), path))
+            return 1;
+        it = (*end) ? end + 1 : end;
+    }
+    return 0;
+}
+
+/* A pattern without wildcard is a path prefix, which matches the path itself
+ * and everything below it. A pattern with wildcards matches the path itself
+ * or any of its parent directories. */
+
+static int pattern_match(char const *const pattern, size_t const pattern_length, char const *const path) {
+    char buffer[pattern_length + 1];
+    memcpy(buffer, pattern, pattern_length);
+    buffer[pattern_length] = 0;
+    // Trailing slashes are not part of the directory name.
+    size_t length = pattern_length;
+    while ((length > 1) && ('/' == buffer[length - 1]))
+        buffer[--length] = 0;
+
+    if (0 == strpbrk(buffer, "*?[")) {
+        return (0 == strncmp(path, buffer, length)) &&
+               (('/' == path[length]) || (0 == path[length]) || ('/' == buffer[length - 1]));
+    }
+
+    size_t const path_length = strlen(path);
+    char prefix[path_length + 1];
+    memcpy(prefix, path, path_length + 1);
+    for (size_t it = path_length; it > 0; --it) {
+        if ((it != path_length) && ('/' != prefix[it]))
+            continue;
+        prefix[it] = 0;
+        if (0 == fnmatch(buffer, prefix, 0))
+            return 1;
+    }
+    return 0;
+}
+
+static int is_compiler(char const *const patterns, char const *const program) {
+    char const *const slash = strrchr(program, '/');
+    char const *const name = (slash) ? slash + 1 : program;
+    for (char const *it = patterns; *it; ) {
+        char const *end = strchr(it, ':');
+        if (0 == end)
+            end = it + strlen(it);
+        size_t const length = (size_t)(end - it);
+        if (length) {
+            char pattern[length + 1];
+            memcpy(pattern, it, length);
+            pattern[length] = 0;
+
+            regex_t regex;
+            if (0 == regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB)) {
+                int const matches = (0 == regexec(&regex, name, 0, 0, 0));
+                regfree(&regex);
+                if (matches)
+                    return 1;
+            }
+        }
+        it = (*end) ? end + 1 : end;
+    }
+    return 0;
+}
+
+static int create_file(char const *const path, char const *const content) {
+    int const fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (-1 == fd) {
+        PERROR("open");
+        return -1;
+    }
+    size_t const length = strlen(content);
+    int const result = (length == (size_t)write(fd, content, length)) ? 0 : -1;
+    if (-1 == result)
+        PERROR("write");
+    if (close(fd))
+        PERROR("close");
+    return result;
+}
+
+static int create_unique(char const *const out_dir, char const *const prefix,
+                         char *const filename, size_t const length) {
+    // Create file name
+    if (-1 == snprintf(filename, length, "%s/%s.XXXXXX", out_dir, prefix))
+        ERROR_AND_EXIT("snprintf");
+    // Create file
+    int const fd = mkstemp(filename);
+    if (-1 == fd)
+        ERROR_AND_EXIT("mkstemp");
+    return fd;
+}
+
+static int simulate_output(char const *const output, char const *const depfile, int const depend) {
+    if (-1 == create_file(output, ""))
+        return 0;
+    if (depfile)
+        return (-1 != create_depfile(depfile, output));
+    if (!depend)
+        return 1;
+
+    // The default dependency file is named after the output.
+    char const *const slash = strrchr(output, '/');
+    char const *const dot = strrchr((slash) ? slash : output, '.');
+    int const stem = (int)((dot) ? (size_t)(dot - output) : strlen(output));
+    size_t const length = strlen(output) + 3;
+    char name[length];
+    if (-1 == snprintf(name, length, "%.*s.d", stem, output))
+        ERROR_AND_EXIT("snprintf");
+    return (-1 != create_depfile(name, output));
+}
+
+static int create_depfile(char const *const depfile, char const *const output) {
+    size_t const length = strlen(output) + 3;
+    char content[length];
+    if (-1 == snprintf(content, length, "%s:\n", output))
+        ERROR_AND_EXIT("snprintf");
+    return create_file(depfile, content);
+}
+
+/* FNV-1a hash of the working directory and the arguments. The strings are
+ * hashed with the terminating zero, to keep the argument boundaries. */
+
+static uint64_t execution_hash(char const *const cwd, char const *const argv[]) {
+    uint64_t hash = fnv_hash(14695981039346656037ull, cwd);
+    for (char const *const *it = argv; (it) && (*it); ++it)
+        hash = fnv_hash(hash, *it);
+    // Zero marks the empty slots.
+    return (hash) ? hash : 1;
+}
+
+static uint64_t fnv_hash(uint64_t hash, char const *const value) {
+    for (char const *it = value; ; ++it) {
+        hash = (hash ^ (unsigned char)*it) * 1099511628211ull;
+        if (0 == *it)
+            return hash;
+    }
+}
+
+static size_t write_content(int fd, void const *const data, size_t const size) {
+    for (size_t written = 0; written < size; ) {
+        ssize_t const result = write(fd, (char const *)data + written, size - written);
+        if (-1 == result)
+            ERROR_AND_EXIT("write");
+        written += (size_t)result;
+    }
+    return size;
+}
+
+#if defined HAVE_ZLIB
+/* The content is compressed as a single zlib stream. The preset dictionary
+ * makes the first reports of the batch compress well too, since those are
+ * repeating the same flags and paths. */
+
+static size_t write_compressed(int fd, bear_dictionary_t const *const dictionary,
+                               char const *const data, size_t const size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != deflateInit(&stream, Z_DEFAULT_COMPRESSION))
+        ERROR_AND_EXIT("deflateInit");
+    if ((dictionary->size > 0) &&
+        (Z_OK != deflateSetDictionary(&stream, dictionary->data, (uInt)dictionary->size)))
+        ERROR_AND_EXIT("deflateSetDictionary");
+
+    uLong const bound = deflateBound(&stream, (uLong)size);
+    unsigned char *const output = malloc(bound);
+    if (0 == output)
+        ERROR_AND_EXIT("malloc");
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)size;
+    stream.next_out = output;
+    stream.avail_out = (uInt)bound;
+    if (Z_STREAM_END != deflate(&stream, Z_FINISH))
+        ERROR_AND_EXIT("deflate");
+    size_t const bytes = write_content(fd, output, (size_t)stream.total_out);
+    free((void *)output);
+    if (Z_OK != deflateEnd(&stream))
+        ERROR_AND_EXIT("deflateEnd");
+    return bytes;
+}
+#endif
+
+#if defined HAVE_ZLIB && defined HAVE_OPEN_MEMSTREAM
+/* Returns the length of the complete reports at the beginning of the data.
+ * (The head of the spool might contain an incomplete report, which is still
+ * written, or the compressed reports.) */
+
+static size_t spool_seed(unsigned char const *const data, size_t const size) {
+    size_t result = 0;
+    while ((result < size) && ('{' == data[result])) {
+        unsigned char const *const end = memchr(data + result, '\n', size - result);
+        if (0 == end)
+            break;
+        result = (size_t)(end - data) + 1;
+    }
+    return result;
+}
+#endif
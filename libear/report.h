@@ -0,0 +1,144 @@
+/*  Copyright (C) 2012-2017 by László Nagy
+    This file is part of Bear.
+
+    Bear is a tool to generate compilation database for clang tooling.
+
+    Bear is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Bear is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * This file implements the execution report writing. It is shared between
+ * the preload library and the compiler wrappers, so both produce the same
+ * report files.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#if defined HAVE_XLOCALE_HEADER
+#include <xlocale.h>
+#endif
+
+#define ENV_OUTPUT "INTERCEPT_BUILD_TARGET_DIR"
+#define ENV_INCLUDE "INTERCEPT_BUILD_INCLUDE"
+#define ENV_EXCLUDE "INTERCEPT_BUILD_EXCLUDE"
+#define ENV_DRY_RUN "INTERCEPT_BUILD_DRY_RUN"
+#define ENV_DEDUP "INTERCEPT_BUILD_DEDUP"
+#define ENV_COMPRESS "INTERCEPT_BUILD_COMPRESS"
+
+#define REPORT_FILE_PREFIX "execution"
+#define PARTIAL_FILE_PREFIX "partial"
+#define SPOOL_FILE_PREFIX REPORT_FILE_PREFIX ".spool."
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+#define AT "libear: (" __FILE__ ":" TOSTRING(__LINE__) ") "
+
+#define PERROR(msg) do { perror(AT msg); } while (0)
+
+#define ERROR_AND_EXIT(msg) do { PERROR(msg); exit(EXIT_FAILURE); } while (0)
+
+
+/* Create a new file in the given directory with the given name prefix.
+ * Returns the open file descriptor. */
+int report_create(char const *out_dir, char const *prefix);
+
+/* Returns a monotonic timestamp in nanoseconds. It orders the executions
+ * of the build, to rebuild the process tree from the reports. */
+unsigned long long report_sequence(void);
+
+/* Write the report of a process execution into a new file in the given
+ * directory. The locale is used to encode the UTF-8 characters. Returns
+ * the number of bytes written. */
+size_t report_write(char const *out_dir, char const *const argv[],
+                    pid_t pid, pid_t ppid, unsigned long long seq, locale_t locale);
+
+/* The preset dictionary of the compressed report files. */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+} bear_dictionary_t;
+
+/* Read the preset dictionary from the given file. (Only the deflate window
+ * size is read, longer dictionary is not used.) The data is allocated with
+ * malloc. Returns -1 on failure. */
+int report_dictionary(char const *filename, bear_dictionary_t *dictionary);
+
+/* Write the given reports into a new file in the given directory. The file
+ * appears with its complete content (it's renamed into place). When the
+ * dictionary is not null, the content is compressed with zlib as a single
+ * stream, with the dictionary (might be empty) as preset. Without zlib
+ * support the content is written as it is. Returns the number of bytes
+ * written. */
+size_t report_store(char const *out_dir, bear_dictionary_t const *dictionary, char const *data, size_t size);
+
+/* Append the report of a process execution to the spool file of the process
+ * group in the given directory. (The processes of a build share the spool,
+ * instead of writing a file for each report.) Each report is appended with
+ * a single write. The first reports of the spool are written as they are,
+ * those are the preset dictionary of the following reports, which are
+ * compressed with zlib one by one. Without zlib support the report is
+ * written into a new file. Returns the number of bytes written. */
+size_t report_spool(char const *out_dir, char const *const argv[],
+                    pid_t pid, pid_t ppid, unsigned long long seq, locale_t locale);
+
+/* Print the report of a process execution into the given stream, as a
+ * single line. (A report file might contain multiple lines.) Returns the
+ * number of bytes written. */
+size_t report_print(FILE *stream, char const *const argv[],
+                    pid_t pid, pid_t ppid, unsigned long long seq, locale_t locale);
+
+/* Decide whether the current process execution shall be reported. The
+ * include and exclude filters are colon separated lists of path prefixes or
+ * glob patterns (both might be null). These are matched against the source
+ * file arguments (made absolute and normalized), or against the working
+ * directory when there is no source file argument. Returns non zero when the
+ * execution shall be reported. */
+int report_accept(char const *include, char const *exclude, char const *const argv[]);
+
+/* The shared hash set of the reported executions. */
+typedef struct {
+    uint64_t *slots;
+    size_t count;
+} bear_seen_t;
+
+/* Map the shared hash set file (might be null), which is created by the
+ * driver. The set is mapped once per process, and it stays mapped until
+ * it's released. Without the file the set is empty. Returns -1 on failure
+ * (the set is empty then too). */
+int report_seen_open(char const *table, bear_seen_t *seen);
+
+/* Unmap the shared hash set. */
+void report_seen_close(bear_seen_t *seen);
+
+/* Check the current process execution against the shared hash set. The key
+ * of the execution is the hash of the working directory and the arguments.
+ * Returns 1 when the key was already in the set, 0 when it's inserted (or
+ * the set is empty) and -1 when the set is full (not inserted). */
+int report_seen(bear_seen_t const *seen, char const *const argv[]);
+
+/* Simulate the compiler call, when the program name matches one of the
+ * patterns (colon separated list of POSIX extended regular expressions).
+ * The simulation creates the empty output and dependency files, which the
+ * compiler would write (link calls included). Calls which write to the
+ * standard output (like preprocessing) are not simulated. Returns non zero
+ * when the call was simulated, and the compiler shall not be executed. */
+int report_dry_run(char const *patterns, char const *const argv[]);
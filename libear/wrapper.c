@@ -0,0 +1,88 @@
+/*  Copyright (C) 2012-2017 by László Nagy
+    This file is part of Bear.
+
+    Bear is a tool to generate compilation database for clang tooling.
+
+    Bear is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Bear is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * This file implements the compiler wrappers. These are an alternative to
+ * the preload library, for build systems which respect the compiler
+ * settings ('CC' and 'CXX' environment variables) or allow to set a
+ * compiler launcher (like 'ccache').
+ *
+ * As compiler the wrapper executes the real compiler, which is passed as
+ * environment variable. As launcher the real compiler is the first argument.
+ * Before that, it writes the same execution report as the preload library.
+ */
+
+#include "config.h"
+#include "report.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <locale.h>
+#include <unistd.h>
+
+#ifndef ENV_COMPILER
+# error ENV_COMPILER shall be defined
+#endif
+
+static void report(char const *const argv[]) {
+    char const *const out_dir = getenv(ENV_OUTPUT);
+    if (0 == out_dir)
+        return;
+    if (!report_accept(getenv(ENV_INCLUDE), getenv(ENV_EXCLUDE), argv))
+        return;
+    // Failing to use the hash set is not fatal, the execution is reported.
+    bear_seen_t seen;
+    if (-1 == report_seen_open(getenv(ENV_DEDUP), &seen))
+        PERROR("report_seen_open");
+    int const duplicate = (1 == report_seen(&seen, argv));
+    report_seen_close(&seen);
+    if (duplicate)
+        return;
+
+    locale_t const utf_locale = newlocale(LC_CTYPE_MASK, "", (locale_t)0);
+    if ((locale_t)0 == utf_locale)
+        ERROR_AND_EXIT("newlocale");
+    if (getenv(ENV_COMPRESS))
+        report_spool(out_dir, argv, getpid(), getppid(), report_sequence(), utf_locale);
+    else
+        report_write(out_dir, argv, getpid(), getppid(), report_sequence(), utf_locale);
+    freelocale(utf_locale);
+}
+
+int main(int argc, char *argv[]) {
+    // Compiler mode: replace the program name with the real compiler.
+    // Launcher mode: the real compiler is the first argument.
+    char const *const compiler = getenv(ENV_COMPILER);
+    char const **const command = (compiler)
+        ? (char const **)argv
+        : (char const **)argv + 1;
+    if (compiler)
+        command[0] = compiler;
+    if ((argc < 1) || (0 == command[0])) {
+        fprintf(stderr, "%s: missing compiler\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    report(command);
+    if (report_dry_run(getenv(ENV_DRY_RUN), command))
+        return EXIT_SUCCESS;
+
+    execvp(command[0], (char *const *)command);
+    ERROR_AND_EXIT("execvp");
+}
@@ -0,0 +1,291 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Copyright (C) 2012-2017 by László Nagy
+# This file is part of Bear.
+#
+# Bear is a tool to generate compilation database for clang tooling.
+#
+# Bear is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Bear is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+""" Synthetic end-to-end benchmark of the Bear pipeline.
+
+The benchmark generates a synthetic build (a shell script which executes
+fake compilers, or the trace directory directly), then runs the stages of
+the 'bear' command one by one and measures the time spent in each:
+
+  trace writing   run the build script with the preload library,
+  walk            list the trace files,
+  parse           read the trace files,
+  classify        recognise the compilations,
+  dedup           remove the duplicate entries,
+  save            write the compilation database (with the collapse),
+  append          merge the result into an existing database (with the
+                  lock, the supersede and the collapse).
+
+The stages call the functions of the 'bear' script, which are run by the
+command itself.
+
+The result is written as JSON. When a baseline result is given, the stages
+which are slower than the baseline (plus the tolerance) are reported and
+the exit status is non zero. """
+
+import argparse
+import json
+import os
+import os.path
+import platform
+import random
+import shutil
+import stat
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def load_bear(path):
+    """ Load the 'bear' script as a module. """
+
+    try:
+        import types
+        from importlib.machinery import SourceFileLoader
+        loader = SourceFileLoader('bear', path)
+        module = types.ModuleType(loader.name)
+        loader.exec_module(module)
+        return module
+    except ImportError:
+        import imp
+        return imp.load_source('bear', path)
+
+
+class Generator(object):
+    """ Generates the synthetic executions of a build. """
+
+    def __init__(self, args, root):
+        self.args = args
+        self.root = root
+        self.random = random.Random(args.seed)
+
+    def executions(self):
+        """ Generates (cwd, cmd) pairs. """
+
+        previous = []
+        for index in range(self.args.execs):
+            if previous and self.random.random() < self.args.duplicates:
+                yield self.random.choice(previous)
+            elif self.random.random() < self.args.non_compilers:
+                yield self.root, ['sh', '-c', 'true {0}'.format(index)]
+            else:
+                execution = self.compilation(index)
+                previous.append(execution)
+                yield execution
+
+    def compilation(self, index):
+        directory = os.path.join(self.root, 'src', str(index % 100))
+        source = 'file{0}.c'.format(index)
+        flags = ['-I{0}/include/{1}'.format(self.root, it)
+                 for it in range(self.args.argv_length // 2)] + \
+                ['-DVALUE_{0}={1}'.format(it, index)
+                 for it in range(self.args.argv_length -
+                                 self.args.argv_length // 2)]
+        compiler = 'c++' if index % 2 else 'cc'
+        return directory, [compiler, '-c'] + flags + \
+            ['-o', source + '.o', source]
+
+    def write_sources(self, executions):
+        for cwd, cmd in executions:
+            if cmd[0] in {'cc', 'c++'}:
+                if not os.path.isdir(cwd):
+                    os.makedirs(cwd)
+                open(os.path.join(cwd, cmd[-1]), 'a').close()
+
+    def write_traces(self, executions, directory):
+        for index, (cwd, cmd) in enumerate(executions):
+            name = os.path.join(directory, 'execution.{0:08d}'.format(index))
+            with open(name, 'w') as handle:
+                json.dump({'pid': index, 'cwd': cwd, 'cmd': cmd}, handle)
+
+    def write_script(self, executions):
+        """ Writes the build script and the fake compilers. """
+
+        bin_dir = os.path.join(self.root, 'bin')
+        os.makedirs(bin_dir)
+        for compiler in ['cc', 'c++']:
+            os.symlink(find_executable('true'),
+                       os.path.join(bin_dir, compiler))
+        script = os.path.join(self.root, 'build.sh')
+        with open(script, 'w') as handle:
+            handle.write('#!/bin/sh\n')
+            handle.write('PATH={0}:$PATH\n'.format(bin_dir))
+            for cwd, cmd in executions:
+                handle.write('cd {0} && {1}\n'.format(
+                    cwd, ' '.join(cmd if cmd[0] != 'sh'
+                                  else ['sh', '-c', "'" + cmd[2] + "'"])))
+        os.chmod(script, os.stat(script).st_mode | stat.S_IEXEC)
+        return script
+
+
+def find_executable(name):
+    for path in os.environ.get('PATH', '').split(os.pathsep):
+        candidate = os.path.join(path, name)
+        if os.path.isfile(candidate) and os.access(candidate, os.X_OK):
+            return candidate
+    raise RuntimeError('could not find {0}'.format(name))
+
+
+class Stopwatch(object):
+    """ Collects the duration of the named stages. """
+
+    def __init__(self):
+        self.stages = []
+
+    def measure(self, name, function, *args):
+        start = time.time()
+        result = function(*args)
+        self.stages.append((name, time.time() - start))
+        return result
+
+
+def run(args, bear, root):
+    generator = Generator(args, root)
+    executions = list(generator.executions())
+    generator.write_sources(executions)
+
+    trace_dir = os.path.join(root, 'traces')
+    os.makedirs(trace_dir)
+    watch = Stopwatch()
+    if args.mode == 'build':
+        script = generator.write_script(executions)
+        environment = dict(os.environ)
+        environment.update({'INTERCEPT_BUILD_TARGET_DIR': trace_dir})
+        libear = os.path.abspath(args.libear)
+        if sys.platform == 'darwin':
+            environment.update({'DYLD_INSERT_LIBRARIES': libear,
+                                'DYLD_FORCE_FLAT_NAMESPACE': '1'})
+        else:
+            environment.update({'LD_PRELOAD': libear})
+        watch.measure('trace writing',
+                      lambda: subprocess.check_call([script], env=environment))
+    else:
+        generator.write_traces(executions, trace_dir)
+
+    files = watch.measure(
+        'walk', lambda: list(bear.exec_trace_files(trace_dir)))
+    calls = watch.measure(
+        'parse', lambda: [call for file in files
+                          for call in bear.parse_exec_trace(file)])
+    current = watch.measure(
+        'classify', lambda: list(bear.compilations(calls, 'cc', 'c++')))
+    entries = watch.measure('dedup', bear.unique, current)
+
+    output = os.path.join(root, 'compile_commands.json')
+    options = argparse.Namespace(cdb=output, index=None, delta=None,
+                                 append=False, checkpoint=False,
+                                 collapse=args.collapse,
+                                 collapse_pattern=None)
+    watch.measure('save', bear.save_output, options, entries,
+                  bear.Statistics())
+    # the same build again, as an incremental run does it
+    options = argparse.Namespace(**dict(vars(options), append=True))
+    watch.measure('append', bear.save_output, options, current,
+                  bear.Statistics())
+
+    return {
+        'parameters': {
+            'mode': args.mode,
+            'execs': args.execs,
+            'argv_length': args.argv_length,
+            'non_compilers': args.non_compilers,
+            'duplicates': args.duplicates,
+            'collapse': args.collapse,
+            'seed': args.seed
+        },
+        'environment': {
+            'python': platform.python_version(),
+            'platform': platform.platform()
+        },
+        'counts': {
+            'trace files': len(files),
+            'compilations': len(current),
+            'entries': len(entries)
+        },
+        'stages': dict(watch.stages),
+        'total': sum(duration for _, duration in watch.stages)
+    }
+
+
+def compare(result, baseline, tolerance):
+    """ Report stages which are slower than the baseline. """
+
+    count = 0
+    for name, duration in sorted(result['stages'].items()):
+        reference = baseline['stages'].get(name)
+        if reference and duration > reference * (1.0 + tolerance):
+            print('regression: {0}: {1:.3f}s (baseline {2:.3f}s)'.format(
+                name, duration, reference))
+            count += 1
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--bear', required=True,
+                        help='path to the configured bear script')
+    parser.add_argument('--libear',
+                        help='path to the preload library (build mode)')
+    parser.add_argument('--mode', choices=['build', 'traces'],
+                        default='traces',
+                        help="""'build' runs a build script with the preload
+                        library, 'traces' writes the trace files directly""")
+    parser.add_argument('--execs', type=int, default=10000,
+                        help='number of executions in the synthetic build')
+    parser.add_argument('--argv-length', type=int, default=20,
+                        help='number of flags of a compiler call')
+    parser.add_argument('--non-compilers', type=float, default=0.5,
+                        help='share of non compiler executions')
+    parser.add_argument('--duplicates', type=float, default=0.1,
+                        help='share of repeated compiler executions')
+    parser.add_argument('--collapse', choices=['first', 'most-flags'],
+                        default='first',
+                        help='collapse policy of the save and append stages')
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--output', '-o', type=argparse.FileType('w'),
+                        default=sys.stdout,
+                        help='JSON result file')
+    parser.add_argument('--baseline', type=argparse.FileType('r'),
+                        help='JSON result file of a previous run')
+    parser.add_argument('--tolerance', type=float, default=0.2,
+                        help='accepted slow down compared to the baseline')
+    args = parser.parse_args()
+    if args.mode == 'build' and not args.libear:
+        parser.error('build mode requires --libear')
+
+    bear = load_bear(args.bear)
+    root = os.path.realpath(tempfile.mkdtemp(prefix='bear-bench-'))
+    try:
+        result = run(args, bear, root)
+    finally:
+        shutil.rmtree(root)
+
+    json.dump(result, args.output, sort_keys=True, indent=4)
+    args.output.write('\n')
+    if args.baseline:
+        return compare(result, json.load(args.baseline), args.tolerance)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())